@@ -2,11 +2,16 @@
 #include <efilib.h>
 
 #define OK      0
-#define QUIT    2
+#define QUIT    3
+#define SUSPEND 4
 #define DIED    1
 #define LIVES   0
 #define PLAY    0
-#define HALL    1
+#define RESUME  1
+#define HALL    2
+#define NO_RESULT       -2
+#define FILTER          -2
+#define MENU_OPTIONS    4
 #define ENTER   u'\r'
 #define PADDING_LEFT    10
 #define PADDING_UP      5
@@ -16,13 +21,23 @@
 #define DARK_GREEN      0x0006402B
 #define RED             0x00FF0000
 #define BLUE            0x000000FF
-#define SCORE_LENGTH    6 * sizeof(CHAR16)
+#define SCORE_LENGTH    (6 * sizeof(CHAR16))
+#define MAX_SCORE       999
 #define INITIAL_INTERVAL        2500000  
+#define IDLE_INTERVAL           500000
+#define SEGMENT_SIZE            50
+#define MAX_PHASES              8
 #define RESULTS_PER_PAGE        10
 #define SCANCODE_DOWN_ARROW     0x2
 #define SCANCODE_UP_ARROW       0x1  
 #define SCANCODE_LEFT_ARROW     0x4
 #define SCANCODE_RIGHT_ARROW    0x3   
+#define SNAPSHOT_FILE           u"snake.sav"
+#define SNAPSHOT_MAGIC          0x4B4E5353
+#define SNAPSHOT_VERSION        1
+#define RECORD_FILE             u"record.txt"
+#define STORAGE_BUFFER_SIZE     4096
+#define PROFILE_FILE            u"startup.log"
 #define min(a, b) ((a) < (b) ? (a) : (b))
 #define max(a, b) ((a) > (b) ? (a) : (b))
 
@@ -59,6 +74,87 @@ struct Snake{
     UINT32 color;
 };
 
+struct SnapshotHeader{
+    UINT32 magic;
+    UINT32 version;
+    INT32 width;
+    INT32 height;
+    INT32 segmentSize;
+    INT32 interval;
+    struct Pair direction;
+    struct Pair previousDirection;
+    struct Pair target;
+    INT32 length;
+};
+
+//One buffer serves both as a read cache and as a pending write batch.
+//Dirty bytes reach the disk only on storageFlush or when the buffer has to move.
+struct StorageFile{
+    EFI_FILE_PROTOCOL *handle;
+    UINT64 size;
+    UINT8 *buffer;
+    UINT64 bufferStart;
+    UINTN bufferLength;
+    bool dirty;
+};
+
+struct Storage{
+    EFI_FILE_PROTOCOL *root;
+    struct StorageFile record;
+};
+
+//tieOrder counts the equal scores recorded before this one, which the
+//hall of fame lists first since new records go after their equals
+struct ScoreEntry{
+    int score;
+    int tieOrder;
+};
+
+struct ScoreList{
+    struct ScoreEntry* data;
+    int capacity;
+    int size;
+};
+
+struct PlayerScores{
+    CHAR16 name[4];
+    struct ScoreList scores;
+};
+
+//Players are kept sorted by name and each player's scores in descending order.
+//tree is a Fenwick tree over score values, used to answer global rank queries.
+struct ScoreIndex{
+    struct PlayerScores* players;
+    int capacity;
+    int size;
+    int total;
+    bool loaded;
+    int tree[MAX_SCORE + 2];
+};
+
+//Located once at startup and shared by every game.
+//surface is a prerendered empty board, copied to the framebuffer when a game starts.
+struct Devices{
+    EFI_GRAPHICS_OUTPUT_PROTOCOL *gop;
+    EFI_RNG_PROTOCOL *rng;
+    UINT32 *surface;
+    int surfaceWidth;
+    int surfaceHeight;
+};
+
+//Timestamps are raw TSC ticks, converted once ticksPerMs is calibrated
+struct Profile{
+    UINT64 start;
+    UINT64 ticksPerMs;
+    const CHAR16 *names[MAX_PHASES];
+    UINT64 times[MAX_PHASES];
+    int count;
+    bool menuDrawn;
+    UINT64 playPressed;
+    UINT64 playDrawn;
+    bool reportPending;
+};
+
 void push_back(EFI_SYSTEM_TABLE *SystemTable, struct Vector *snake, struct Pair *segment){
         if(snake->size == snake->capacity){
                 int newCapacity = snake->capacity * 2;
@@ -98,6 +194,17 @@ EFI_INPUT_KEY getKey(EFI_SYSTEM_TABLE *SystemTable){
         return key;
 }
 
+void showMessage(EFI_SYSTEM_TABLE *SystemTable, const CHAR16 *message){
+        uefi_call_wrapper(SystemTable->ConOut->ClearScreen, 1, SystemTable->ConOut);
+        uefi_call_wrapper(SystemTable->ConOut->SetAttribute, 2,
+                                SystemTable->ConOut, EFI_TEXT_ATTR(EFI_WHITE, EFI_BLACK));
+        uefi_call_wrapper(SystemTable->ConOut->SetCursorPosition, 3, SystemTable->ConOut, PADDING_LEFT, PADDING_UP); 
+        uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, message);
+        uefi_call_wrapper(SystemTable->ConOut->SetCursorPosition, 3, SystemTable->ConOut, PADDING_LEFT, PADDING_UP + 2); 
+        uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, u"PRESS ANY KEY");
+        getKey(SystemTable);
+}
+
 bool isFree(int x, int y, struct Snake *snake){
         for(int i = 0; i < snake->segments.size; i++){
                 if(x == snake->segments.data[i].x && y == snake->segments.data[i].y){
@@ -107,18 +214,243 @@ bool isFree(int x, int y, struct Snake *snake){
         return true;
 }
 
-EFI_STATUS getFileProtocol(EFI_SYSTEM_TABLE *SystemTable, EFI_FILE_PROTOCOL** Root){
+EFI_STATUS storageOpen(EFI_SYSTEM_TABLE *SystemTable, struct Storage *storage, const CHAR16 *name, bool create, struct StorageFile *file){
+        EFI_STATUS status;
+        UINT64 mode = EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE;
+        if(create){
+                mode |= EFI_FILE_MODE_CREATE;
+        }
+        status = uefi_call_wrapper(storage->root->Open, 5, storage->root, &file->handle, (CHAR16*)name, mode, 0);
+        if(EFI_ERROR(status)){
+                return status;
+        }
+
+        UINTN infoSize = 0;
+        EFI_FILE_INFO *info = NULL;
+        //The first call only reports how big the info structure is
+        status = uefi_call_wrapper(file->handle->GetInfo, 4, file->handle, &gEfiFileInfoGuid, &infoSize, NULL);
+        if(status == EFI_BUFFER_TOO_SMALL){
+                status = uefi_call_wrapper(SystemTable->BootServices->AllocatePool, 3, EfiLoaderData, infoSize, (void**)&info);
+        }
+        else if(!EFI_ERROR(status)){
+                status = EFI_DEVICE_ERROR;
+        }
+        if(!EFI_ERROR(status)){
+                status = uefi_call_wrapper(file->handle->GetInfo, 4, file->handle, &gEfiFileInfoGuid, &infoSize, info);
+                if(!EFI_ERROR(status)){
+                        file->size = info->FileSize;
+                }
+                uefi_call_wrapper(SystemTable->BootServices->FreePool, 1, info);
+        }
+        if(!EFI_ERROR(status)){
+                status = uefi_call_wrapper(SystemTable->BootServices->AllocatePool, 3,
+                                                EfiLoaderData, STORAGE_BUFFER_SIZE, (void**)&file->buffer);
+        }
+        if(EFI_ERROR(status)){
+                uefi_call_wrapper(file->handle->Close, 1, file->handle);
+                file->handle = NULL;
+                return status;
+        }
+        file->bufferStart = 0;
+        file->bufferLength = 0;
+        file->dirty = false;
+        return EFI_SUCCESS;
+}
+
+//Hands dirty bytes to the file without asking the firmware to commit them
+EFI_STATUS storageWriteBack(struct StorageFile *file){
+        if(!file->dirty){
+                return EFI_SUCCESS;
+        }
+        UINTN size = file->bufferLength;
+        EFI_STATUS status = uefi_call_wrapper(file->handle->SetPosition, 2, file->handle, file->bufferStart);
+        if(!EFI_ERROR(status)){
+                status = uefi_call_wrapper(file->handle->Write, 3, file->handle, &size, file->buffer);
+        }
+        if(!EFI_ERROR(status) && size != file->bufferLength){
+                status = EFI_DEVICE_ERROR;
+        }
+        if(EFI_ERROR(status)){
+                return status;
+        }
+        file->dirty = false;
+        return EFI_SUCCESS;
+}
+
+EFI_STATUS storageFlush(struct StorageFile *file){
+        EFI_STATUS status = storageWriteBack(file);
+        if(EFI_ERROR(status)){
+                return status;
+        }
+        return uefi_call_wrapper(file->handle->Flush, 1, file->handle);
+}
+
+//size is updated to the number of bytes actually read
+EFI_STATUS storageRead(struct StorageFile *file, UINT64 position, UINTN *size, void *data){
+        EFI_STATUS status;
+        if(position >= file->size){
+                *size = 0;
+                return EFI_SUCCESS;
+        }
+        *size = min(*size, file->size - position);
+
+        bool cached = position >= file->bufferStart && position + *size <= file->bufferStart + file->bufferLength;
+        if(!cached){
+                status = storageWriteBack(file);
+                if(EFI_ERROR(status)){
+                        return status;
+                }
+                file->bufferLength = 0;
+                status = uefi_call_wrapper(file->handle->SetPosition, 2, file->handle, position);
+                if(EFI_ERROR(status)){
+                        return status;
+                }
+                if(*size >= STORAGE_BUFFER_SIZE){
+                        return uefi_call_wrapper(file->handle->Read, 3, file->handle, size, data);
+                }
+                UINTN length = STORAGE_BUFFER_SIZE;
+                status = uefi_call_wrapper(file->handle->Read, 3, file->handle, &length, file->buffer);
+                if(EFI_ERROR(status)){
+                        return status;
+                }
+                file->bufferStart = position;
+                file->bufferLength = length;
+                *size = min(*size, length);
+        }
+        CopyMem(data, file->buffer + (position - file->bufferStart), *size);
+        return EFI_SUCCESS;
+}
+
+EFI_STATUS storageWrite(struct StorageFile *file, UINT64 position, UINTN size, void *data){
+        EFI_STATUS status;
+        if(file->bufferLength == 0){
+                file->bufferStart = position;
+        }
+        bool fits = position >= file->bufferStart && position <= file->bufferStart + file->bufferLength
+                        && position + size <= file->bufferStart + STORAGE_BUFFER_SIZE;
+        if(!fits){
+                status = storageWriteBack(file);
+                if(EFI_ERROR(status)){
+                        return status;
+                }
+                file->bufferStart = position;
+                file->bufferLength = 0;
+                if(size >= STORAGE_BUFFER_SIZE){
+                        UINTN written = size;
+                        status = uefi_call_wrapper(file->handle->SetPosition, 2, file->handle, position);
+                        if(!EFI_ERROR(status)){
+                                status = uefi_call_wrapper(file->handle->Write, 3, file->handle, &written, data);
+                        }
+                        if(!EFI_ERROR(status) && written != size){
+                                status = EFI_DEVICE_ERROR;
+                        }
+                        if(EFI_ERROR(status)){
+                                return status;
+                        }
+                        file->size = max(file->size, position + size);
+                        return EFI_SUCCESS;
+                }
+        }
+        CopyMem(file->buffer + (position - file->bufferStart), data, size);
+        file->bufferLength = max(file->bufferLength, position + size - file->bufferStart);
+        file->size = max(file->size, position + size);
+        file->dirty = true;
+        return EFI_SUCCESS;
+}
+
+EFI_STATUS storageClose(EFI_SYSTEM_TABLE *SystemTable, struct StorageFile *file){
+        if(file->handle == NULL){
+                return EFI_SUCCESS;
+        }
+        EFI_STATUS status = storageFlush(file);
+        uefi_call_wrapper(file->handle->Close, 1, file->handle);
+        uefi_call_wrapper(SystemTable->BootServices->FreePool, 1, file->buffer);
+        file->handle = NULL;
+        return status;
+}
+
+//Pending writes are dropped, the file is going away anyway
+EFI_STATUS storageDelete(EFI_SYSTEM_TABLE *SystemTable, struct StorageFile *file){
+        EFI_STATUS status = uefi_call_wrapper(file->handle->Delete, 1, file->handle);
+        uefi_call_wrapper(SystemTable->BootServices->FreePool, 1, file->buffer);
+        file->handle = NULL;
+        return status;
+}
+
+EFI_STATUS storageInit(EFI_SYSTEM_TABLE *SystemTable, struct Storage *storage){
         EFI_STATUS status;
         EFI_SIMPLE_FILE_SYSTEM_PROTOCOL *fileSystem;
         EFI_GUID guid = EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_GUID;
         status = uefi_call_wrapper(SystemTable->BootServices->LocateProtocol, 3, &guid, NULL, (void**)&fileSystem);
-        if(status != EFI_SUCCESS){
+        if(EFI_ERROR(status)){
                 return status;
         }
-        status = uefi_call_wrapper(fileSystem->OpenVolume, 2, fileSystem, Root);
+        status = uefi_call_wrapper(fileSystem->OpenVolume, 2, fileSystem, &storage->root);
+        if(EFI_ERROR(status)){
+                return status;
+        }
+        status = storageOpen(SystemTable, storage, RECORD_FILE, true, &storage->record);
+        if(EFI_ERROR(status)){
+                uefi_call_wrapper(storage->root->Close, 1, storage->root);
+        }
+        return status;
+}
+
+EFI_STATUS storageShutdown(EFI_SYSTEM_TABLE *SystemTable, struct Storage *storage){
+        EFI_STATUS status = storageClose(SystemTable, &storage->record);
+        uefi_call_wrapper(storage->root->Close, 1, storage->root);
         return status;
 }
 
+//The app is only built for x86_64, so the TSC is always there
+UINT64 readTimestamp(void){
+        UINT32 low, high;
+        __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+        return ((UINT64)high << 32) | low;
+}
+
+void markPhase(struct Profile *profile, const CHAR16 *name){
+        if(profile->count < MAX_PHASES){
+                profile->names[profile->count] = name;
+                profile->times[profile->count] = readTimestamp();
+                profile->count++;
+        }
+        profile->reportPending = true;
+}
+
+void calibrateProfile(EFI_SYSTEM_TABLE *SystemTable, struct Profile *profile){
+        UINT64 before = readTimestamp();
+        uefi_call_wrapper(SystemTable->BootServices->Stall, 1, 1000);
+        profile->ticksPerMs = max(readTimestamp() - before, 1);
+}
+
+int toMicroseconds(struct Profile *profile, UINT64 ticks){
+        return (ticks * 1000) / profile->ticksPerMs;
+}
+
+EFI_STATUS initDevices(EFI_SYSTEM_TABLE *SystemTable, struct Devices *devices){
+        EFI_GUID gopGuid = EFI_GRAPHICS_OUTPUT_PROTOCOL_GUID;
+        EFI_STATUS gopStatus = uefi_call_wrapper(SystemTable->BootServices->LocateProtocol, 3,
+                                                        &gopGuid, NULL, (void**)&devices->gop);
+
+        if(EFI_ERROR(gopStatus)){
+                uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, u"Couldn't get GOP");
+                return gopStatus;
+        }
+
+        EFI_GUID rngGuid = EFI_RNG_PROTOCOL_GUID;
+        EFI_STATUS rngStatus = uefi_call_wrapper(SystemTable->BootServices->LocateProtocol, 3,
+                                                        &rngGuid, NULL, (void**)&devices->rng);
+
+        if(EFI_ERROR(rngStatus)){
+                uefi_call_wrapper(SystemTable->ConOut->OutputString, 2,
+                        SystemTable->ConOut, u"Couldn't get RNG Protocol");
+                return rngStatus;
+        }
+        devices->surface = NULL;
+        return EFI_SUCCESS;
+}
+
 EFI_STATUS random(EFI_RNG_PROTOCOL *rng, struct BoardData *board, struct Snake *snake){
         UINT32 index;
         EFI_STATUS status;
@@ -177,6 +509,53 @@ void drawBoard(EFI_GRAPHICS_OUTPUT_PROTOCOL *gop, struct BoardData *board){
         drawRect(gop, board->target.x, board->target.y, size, size, board->targetColor);
 }
 
+//Rows inside one row of cells are identical, so only the first one is rendered
+EFI_STATUS prepareSurface(EFI_SYSTEM_TABLE *SystemTable, struct Devices *devices){
+        if(devices->surface != NULL){
+                return EFI_SUCCESS;
+        }
+        EFI_GRAPHICS_OUTPUT_PROTOCOL *gop = devices->gop;
+        int width = (gop->Mode->Info->HorizontalResolution / SEGMENT_SIZE) * SEGMENT_SIZE;
+        int height = (gop->Mode->Info->VerticalResolution / SEGMENT_SIZE) * SEGMENT_SIZE;
+        UINT32 *surface;
+        EFI_STATUS status = uefi_call_wrapper(SystemTable->BootServices->AllocatePool, 3,
+                                                EfiLoaderData, width * height * sizeof(UINT32), (void**)&surface);
+        if(EFI_ERROR(status)){
+                return status;
+        }
+
+        for(int y = 0; y < height; y += SEGMENT_SIZE){
+                UINT32 *row = surface + y * width;
+                for(int x = 0; x < width; x++){
+                        int rowIndex = y / SEGMENT_SIZE, colIndex = x / SEGMENT_SIZE;
+                        row[x] = (rowIndex + colIndex) % 2 == 0 ? LIGHT_GREEN : DARK_GREEN;
+                }
+                for(int i = 1; i < SEGMENT_SIZE; i++){
+                        CopyMem(row + i * width, row, width * sizeof(UINT32));
+                }
+        }
+        devices->surface = surface;
+        devices->surfaceWidth = width;
+        devices->surfaceHeight = height;
+        return EFI_SUCCESS;
+}
+
+void presentBoard(struct Devices *devices, struct BoardData *board){
+        bool matches = devices->surface != NULL && devices->surfaceWidth == board->width
+                        && devices->surfaceHeight == board->height && board->segmentSize == SEGMENT_SIZE;
+        if(!matches){
+                drawBoard(devices->gop, board);
+                return;
+        }
+        //Same raw pixel values putPixel writes, so later updates match on any pixel format
+        UINT32* location = (UINT32*)devices->gop->Mode->FrameBufferBase;
+        UINT32 pitch = devices->gop->Mode->Info->PixelsPerScanLine;
+        for(int y = 0; y < board->height; y++){
+                CopyMem(location + y * pitch, devices->surface + y * board->width, board->width * sizeof(UINT32));
+        }
+        drawRect(devices->gop, board->target.x, board->target.y, board->segmentSize, board->segmentSize, board->targetColor);
+}
+
 bool areOpposite(struct Pair a, struct Pair b){
         return a.x + b.x == 0 && a.y + b.y == 0;
 }
@@ -212,6 +591,9 @@ int handleKey(EFI_SYSTEM_TABLE *SystemTable, struct Snake *snake){
         else if(key.UnicodeChar == 'q'){
                 return QUIT;
         }
+        else if(key.UnicodeChar == 'p'){
+                return SUSPEND;
+        }
         return OK;
 }
 
@@ -273,34 +655,150 @@ int snakeMove(EFI_GRAPHICS_OUTPUT_PROTOCOL *gop, struct Snake *snake, struct Boa
         return LIVES;
 }
 
-int snake(EFI_SYSTEM_TABLE *SystemTable){
-        EFI_GRAPHICS_OUTPUT_PROTOCOL *gop;
-        EFI_GUID gopGuid = EFI_GRAPHICS_OUTPUT_PROTOCOL_GUID;
-        EFI_STATUS gopStatus = uefi_call_wrapper(SystemTable->BootServices->LocateProtocol, 3,
-                                                        &gopGuid, NULL, (void**)&gop);
+void drawSnake(EFI_GRAPHICS_OUTPUT_PROTOCOL *gop, struct Snake *snake, struct BoardData *board){
+        for(int i = 0; i < snake->segments.size; i++){
+                drawRect(gop, snake->segments.data[i].x, snake->segments.data[i].y,
+                                board->segmentSize, board->segmentSize, snake->color);
+        }
+}
 
-        if(EFI_ERROR(gopStatus)){
-                uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, u"Couldn't get GOP");
-                uefi_call_wrapper(SystemTable->RuntimeServices->ResetSystem, 4,
-                                        EfiResetShutdown, EFI_SUCCESS, 0, NULL);
-                return -1;
+//Header and segments are packed into one buffer so the snapshot costs a single Write
+EFI_STATUS saveSnapshot(EFI_SYSTEM_TABLE *SystemTable, struct Storage *storage, struct Snake *snake, struct BoardData *board, int interval){
+        EFI_STATUS status;
+        UINTN segmentsSize = snake->segments.size * sizeof(struct Pair);
+        UINTN size = sizeof(struct SnapshotHeader) + segmentsSize;
+        UINT8 *buffer;
+        status = uefi_call_wrapper(SystemTable->BootServices->AllocatePool, 3, EfiLoaderData, size, (void**)&buffer);
+        if(EFI_ERROR(status)){
+                return status;
         }
-        uefi_call_wrapper(gop->SetMode, 2, gop, 0);
 
-        EFI_RNG_PROTOCOL *rng;
-        EFI_GUID rngGuid = EFI_RNG_PROTOCOL_GUID;
-        EFI_STATUS rngStatus = uefi_call_wrapper(SystemTable->BootServices->LocateProtocol, 3,
-                                                        &rngGuid, NULL, (void**)&rng);
+        struct SnapshotHeader *header = (struct SnapshotHeader*)buffer;
+        header->magic = SNAPSHOT_MAGIC;
+        header->version = SNAPSHOT_VERSION;
+        header->width = board->width;
+        header->height = board->height;
+        header->segmentSize = board->segmentSize;
+        header->interval = interval;
+        header->direction = snake->direction;
+        header->previousDirection = snake->previousDirection;
+        header->target = board->target;
+        header->length = snake->segments.size;
+        CopyMem(buffer + sizeof(struct SnapshotHeader), snake->segments.data, segmentsSize);
+
+        //An older, longer snapshot would leave trailing bytes behind
+        struct StorageFile file;
+        if(!EFI_ERROR(storageOpen(SystemTable, storage, SNAPSHOT_FILE, false, &file))){
+                storageDelete(SystemTable, &file);
+        }
 
-        if(EFI_ERROR(rngStatus)){
-                uefi_call_wrapper(SystemTable->ConOut->OutputString, 2,
-                        SystemTable->ConOut, u"Couldn't get RNG Protocol");
-                uefi_call_wrapper(SystemTable->RuntimeServices->ResetSystem, 4,
-                        EfiResetShutdown, EFI_SUCCESS, 0, NULL);
-                return -1;
+        status = storageOpen(SystemTable, storage, SNAPSHOT_FILE, true, &file);
+        if(!EFI_ERROR(status)){
+                status = storageWrite(&file, 0, size, buffer);
+                EFI_STATUS closeStatus = storageClose(SystemTable, &file);
+                if(!EFI_ERROR(status)){
+                        status = closeStatus;
+                }
+        }
+        uefi_call_wrapper(SystemTable->BootServices->FreePool, 1, buffer);
+        return status;
+}
+
+bool isOnBoard(struct Pair cell, struct BoardData *board){
+        int size = board->segmentSize;
+        return cell.x >= 0 && cell.y >= 0 && cell.x + size <= board->width && cell.y + size <= board->height
+                && cell.x % size == 0 && cell.y % size == 0;
+}
+
+bool isDirection(struct Pair direction){
+        return (direction.x == 0 && (direction.y == 1 || direction.y == -1))
+                || (direction.y == 0 && (direction.x == 1 || direction.x == -1));
+}
+
+//Everything restored is later drawn straight into the framebuffer, so nothing is trusted
+bool isValidSnapshot(struct SnapshotHeader *header, UINTN size, struct BoardData *board){
+        if(size < sizeof(struct SnapshotHeader)){
+                return false;
+        }
+        if(header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION){
+                return false;
+        }
+        if(header->width != board->width || header->height != board->height || header->segmentSize != board->segmentSize){
+                return false;
+        }
+        int cells = (board->width / board->segmentSize) * (board->height / board->segmentSize);
+        if(header->length < 1 || header->length > cells){
+                return false;
+        }
+        if(size != sizeof(struct SnapshotHeader) + header->length * sizeof(struct Pair)){
+                return false;
+        }
+        if(header->interval <= 0 || !isDirection(header->direction) || !isDirection(header->previousDirection)){
+                return false;
+        }
+        if(!isOnBoard(header->target, board)){
+                return false;
+        }
+        struct Pair *segments = (struct Pair*)(header + 1);
+        for(int i = 0; i < header->length; i++){
+                if(!isOnBoard(segments[i], board)){
+                        return false;
+                }
+        }
+        return true;
+}
+
+//Restoring consumes the snapshot, so a finished run cannot be resumed twice
+EFI_STATUS loadSnapshot(EFI_SYSTEM_TABLE *SystemTable, struct Storage *storage, struct Snake *snake, struct BoardData *board, int *interval){
+        EFI_STATUS status;
+        struct StorageFile file;
+        status = storageOpen(SystemTable, storage, SNAPSHOT_FILE, false, &file);
+        if(EFI_ERROR(status)){
+                return status;
+        }
+
+        UINTN size = file.size;
+        UINT8 *buffer = NULL;
+        status = uefi_call_wrapper(SystemTable->BootServices->AllocatePool, 3,
+                                        EfiLoaderData, max(size, sizeof(struct SnapshotHeader)), (void**)&buffer);
+        if(!EFI_ERROR(status)){
+                status = storageRead(&file, 0, &size, buffer);
+        }
+
+        struct SnapshotHeader *header = (struct SnapshotHeader*)buffer;
+        if(!EFI_ERROR(status) && !isValidSnapshot(header, size, board)){
+                status = EFI_COMPROMISED_DATA;
         }
+        if(!EFI_ERROR(status)){
+                status = uefi_call_wrapper(SystemTable->BootServices->AllocatePool, 3, EfiLoaderData,
+                                                header->length * sizeof(struct Pair), (void**)&snake->segments.data);
+        }
+        if(!EFI_ERROR(status)){
+                CopyMem(snake->segments.data, buffer + sizeof(struct SnapshotHeader), header->length * sizeof(struct Pair));
+                snake->segments.size = header->length;
+                snake->segments.capacity = header->length;
+                snake->direction = header->direction;
+                snake->previousDirection = header->previousDirection;
+                board->target = header->target;
+                *interval = header->interval;
+                storageDelete(SystemTable, &file);
+        }
+        else{
+                storageClose(SystemTable, &file);
+        }
+
+        if(buffer != NULL){
+                uefi_call_wrapper(SystemTable->BootServices->FreePool, 1, buffer);
+        }
+        return status;
+}
 
-        int interval = INITIAL_INTERVAL, segmentSize = 50;   
+int snake(EFI_SYSTEM_TABLE *SystemTable, struct Storage *storage, struct Devices *devices, struct Profile *profile, bool resume){
+        profile->playPressed = readTimestamp();
+        EFI_GRAPHICS_OUTPUT_PROTOCOL *gop = devices->gop;
+        EFI_RNG_PROTOCOL *rng = devices->rng;
+
+        int interval = INITIAL_INTERVAL, segmentSize = SEGMENT_SIZE;   
         int width = (gop->Mode->Info->HorizontalResolution / segmentSize) * segmentSize;
         int height = (gop->Mode->Info->VerticalResolution / segmentSize) * segmentSize;
 
@@ -314,38 +812,60 @@ int snake(EFI_SYSTEM_TABLE *SystemTable){
                 .targetAlive = true
         };
 
-        struct Vector segments = {
-                .capacity = 1,
-                .size = 0
-        };
-
-        uefi_call_wrapper(SystemTable->BootServices->AllocatePool, 3,
-                                EfiLoaderData, sizeof(struct Pair), (void**)&segments.data);
-
-        struct Pair start = {100, 100};
-        push_back(SystemTable, &segments, &start);
-
-
         struct Snake snake = {
-                .segments = segments,
                 .direction = RIGHT,
                 .previousDirection = RIGHT,
                 .color = BLUE
         };
 
-        EFI_STATUS randStatus = random(rng, &board, &snake);
-        if(EFI_ERROR(randStatus)){
-                uefi_call_wrapper(SystemTable->RuntimeServices->ResetSystem, 4,
-                                        EfiResetShutdown, EFI_SUCCESS, 0, NULL);
-                return -1;
+        if(resume){
+                EFI_STATUS snapshotStatus = loadSnapshot(SystemTable, storage, &snake, &board, &interval);
+                if(snapshotStatus == EFI_NOT_FOUND){
+                        showMessage(SystemTable, u"NO SAVED GAME");
+                        return NO_RESULT;
+                }
+                if(snapshotStatus == EFI_COMPROMISED_DATA){
+                        showMessage(SystemTable, u"SNAPSHOT INVALID");
+                        return NO_RESULT;
+                }
+                if(EFI_ERROR(snapshotStatus)){
+                        showMessage(SystemTable, u"COULDN'T LOAD SAVED GAME");
+                        return NO_RESULT;
+                }
+        }
+        else{
+                struct Vector segments = {
+                        .capacity = 1,
+                        .size = 0
+                };
+
+                uefi_call_wrapper(SystemTable->BootServices->AllocatePool, 3,
+                                        EfiLoaderData, sizeof(struct Pair), (void**)&segments.data);
+
+                struct Pair start = {100, 100};
+                push_back(SystemTable, &segments, &start);
+                snake.segments = segments;
+
+                EFI_STATUS randStatus = random(rng, &board, &snake);
+                if(EFI_ERROR(randStatus)){
+                        uefi_call_wrapper(SystemTable->RuntimeServices->ResetSystem, 4,
+                                                EfiResetShutdown, EFI_SUCCESS, 0, NULL);
+                        return -1;
+                }
         }
 
         EFI_EVENT events[2];
         uefi_call_wrapper(SystemTable->BootServices->CreateEvent, 5, EVT_TIMER, 0, NULL, NULL, &events[0]);
         uefi_call_wrapper(SystemTable->BootServices->SetTimer, 3, events[0], TimerPeriodic, interval);
         events[1] = SystemTable->ConIn->WaitForKey;
-        drawBoard(gop, &board);
+        presentBoard(devices, &board);
+        if(resume){
+                drawSnake(gop, &snake, &board);
+        }
+        profile->playDrawn = readTimestamp();
+        profile->reportPending = true;
 
+        bool suspended = false;
         while(true){
                 UINTN index;
                 uefi_call_wrapper(SystemTable->BootServices->WaitForEvent, 3, 2, events, &index);
@@ -368,100 +888,269 @@ int snake(EFI_SYSTEM_TABLE *SystemTable){
                         if(q == QUIT){
                                 break;
                         }
+                        if(q == SUSPEND){
+                                EFI_STATUS snapshotStatus = saveSnapshot(SystemTable, storage, &snake, &board, interval);
+                                if(!EFI_ERROR(snapshotStatus)){
+                                        suspended = true;
+                                        break;
+                                }
+                                showMessage(SystemTable, u"COULDN'T SAVE THE GAME");
+                                presentBoard(devices, &board);
+                                drawSnake(gop, &snake, &board);
+                        }
                 }
         }
-        int score = snake.segments.size;
+        int score = suspended ? NO_RESULT : snake.segments.size;
         free(SystemTable, &snake.segments);
         
         return score;
 }
 
-int menu(EFI_SYSTEM_TABLE *SystemTable){
-        uefi_call_wrapper(SystemTable->ConOut->SetAttribute, 2,
-                                SystemTable->ConOut, EFI_TEXT_ATTR(EFI_WHITE, EFI_BLACK));
-        int currentSelection = PLAY;
-        const CHAR16 *options[] = {
-                u"      PLAY      ",
-                u"  HALL OF FAME  ",
-                u"      QUIT      "
-        };
+void intToString(int x, CHAR16* s){
+        if(x == 0){
+                s[0] = u'0';
+                s[1] = u'\0';
+                return;
+        }
+        int i = 0;
+        while(x > 0){
+                s[i] = (x % 10) + u'0';
+                i++;
+                x /= 10;
+        }
+        
+        for(int j = 0; j < i / 2; j++){
+                CHAR16 tmp = s[j];
+                s[j] = s[i - j - 1];
+                s[i - j - 1] = tmp;
+        }
+        s[i] = u'\0';
+}
 
-        bool change = true;
-        while(true){
-                if(change){
-                        change = false;
-                        uefi_call_wrapper(SystemTable->ConOut->ClearScreen, 1, SystemTable->ConOut);
-                        for(int i = 0; i < 3; i++){
-                                uefi_call_wrapper(SystemTable->ConOut->SetCursorPosition, 3,
-                                                        SystemTable->ConOut, PADDING_LEFT, PADDING_UP + i);
-                                if(i == currentSelection){
-                                        uefi_call_wrapper(SystemTable->ConOut->SetAttribute, 2,
-                                                                SystemTable->ConOut,
-                                                                EFI_TEXT_ATTR(EFI_WHITE, EFI_BROWN)
-                                        );
-                                        uefi_call_wrapper(SystemTable->ConOut->OutputString, 2,
-                                                                SystemTable->ConOut, options[i]);
-                                        uefi_call_wrapper(SystemTable->ConOut->SetAttribute, 2,
-                                                                SystemTable->ConOut,
-                                                                EFI_TEXT_ATTR(EFI_WHITE, EFI_BLACK)
-                                        );
-                                }
-                                else{
-                                        uefi_call_wrapper(SystemTable->ConOut->OutputString, 2,
-                                                                SystemTable->ConOut, options[i]);
-                                }
-                        }
+int parseScore(CHAR16* record){
+        return (record[3] - u'0') * 100 + (record[4] - u'0') * 10 + (record[5] - u'0');
+}
+
+EFI_STATUS reserve(EFI_SYSTEM_TABLE *SystemTable, void** data, int* capacity, int size, UINTN elementSize){
+        if(size < *capacity){
+                return EFI_SUCCESS;
+        }
+        int newCapacity = max(*capacity * 2, 4);
+        void* newData = NULL;
+        EFI_STATUS status = uefi_call_wrapper(SystemTable->BootServices->AllocatePool, 3,
+                                                EfiLoaderData, newCapacity * elementSize, &newData);
+        if(EFI_ERROR(status)){
+                return status;
+        }
+        if(*data != NULL){
+                CopyMem(newData, *data, size * elementSize);
+                uefi_call_wrapper(SystemTable->BootServices->FreePool, 1, *data);
+        }
+        *data = newData;
+        *capacity = newCapacity;
+        return EFI_SUCCESS;
+}
+
+int compareNames(const CHAR16* a, const CHAR16* b){
+        for(int i = 0; i < 3; i++){
+                if(a[i] != b[i]){
+                        return a[i] < b[i] ? -1 : 1;
                 }
-                EFI_INPUT_KEY key = getKey(SystemTable);
+        }
+        return 0;
+}
 
-                if(key.ScanCode == SCANCODE_UP_ARROW){
-                        change = (currentSelection != PLAY);
-                        if(currentSelection == QUIT){
-                                currentSelection = HALL;
-                        }
-                        else{
-                                currentSelection = PLAY;
-                        }
+//Returns the position of the player, or the position it should be inserted at
+int findPlayer(struct ScoreIndex *index, const CHAR16* name, bool* found){
+        int low = 0, high = index->size;
+        while(low < high){
+                int mid = (low + high) / 2;
+                if(compareNames(index->players[mid].name, name) < 0){
+                        low = mid + 1;
                 }
-                else if(key.ScanCode == SCANCODE_DOWN_ARROW){
-                        change = (currentSelection != QUIT);
-                        if(currentSelection == PLAY){
-                                currentSelection = HALL;
-                        }
-                        else{
-                                currentSelection = QUIT;
-                        }
+                else{
+                        high = mid;
                 }
-                else if(key.UnicodeChar == ENTER){
-                        return currentSelection;
+        }
+        *found = (low < index->size && compareNames(index->players[low].name, name) == 0);
+        return low;
+}
+
+struct PlayerScores* getPlayer(struct ScoreIndex *index, const CHAR16* name){
+        bool found;
+        int position = findPlayer(index, name, &found);
+        return found ? &index->players[position] : NULL;
+}
+
+//Number of recorded scores greater than or equal to score
+int countAtLeast(struct ScoreIndex *index, int score){
+        if(score > MAX_SCORE){
+                return 0;
+        }
+        int below = 0;
+        for(int i = max(score, 0); i > 0; i -= i & -i){
+                below += index->tree[i];
+        }
+        return index->total - below;
+}
+
+//Position of the record in the hall of fame
+int globalRank(struct ScoreIndex *index, struct ScoreEntry *entry){
+        return countAtLeast(index, entry->score + 1) + entry->tieOrder + 1;
+}
+
+int personalBest(struct ScoreIndex *index, const CHAR16* name){
+        struct PlayerScores *player = getPlayer(index, name);
+        return player != NULL ? player->scores.data[0].score : -1;
+}
+
+int playerRank(struct ScoreIndex *index, const CHAR16* name){
+        struct PlayerScores *player = getPlayer(index, name);
+        return player != NULL ? globalRank(index, &player->scores.data[0]) : -1;
+}
+
+//Copies up to k of the player's scores, best first, skipping the first offset of them.
+//Returns how many were copied.
+int topScores(struct ScoreIndex *index, const CHAR16* name, int offset, int k, struct ScoreEntry* out){
+        struct PlayerScores *player = getPlayer(index, name);
+        if(player == NULL || offset >= player->scores.size){
+                return 0;
+        }
+        int count = min(k, player->scores.size - offset);
+        for(int i = 0; i < count; i++){
+                out[i] = player->scores.data[offset + i];
+        }
+        return count;
+}
+
+EFI_STATUS indexScore(EFI_SYSTEM_TABLE *SystemTable, struct ScoreIndex *index, const CHAR16* name, int score){
+        EFI_STATUS status;
+        score = min(max(score, 0), MAX_SCORE);
+
+        bool found;
+        int position = findPlayer(index, name, &found);
+        if(!found){
+                //The score list is reserved first so a failure never leaves an empty player behind
+                struct PlayerScores player = {
+                        .name = {name[0], name[1], name[2], u'\0'},
+                        .scores = {.data = NULL, .capacity = 0, .size = 0}
+                };
+                status = reserve(SystemTable, (void**)&player.scores.data, &player.scores.capacity, 0, sizeof(struct ScoreEntry));
+                if(EFI_ERROR(status)){
+                        return status;
                 }
+                status = reserve(SystemTable, (void**)&index->players, &index->capacity,
+                                        index->size, sizeof(struct PlayerScores));
+                if(EFI_ERROR(status)){
+                        uefi_call_wrapper(SystemTable->BootServices->FreePool, 1, player.scores.data);
+                        return status;
+                }
+                for(int i = index->size; i > position; i--){
+                        index->players[i] = index->players[i - 1];
+                }
+                index->players[position] = player;
+                index->size++;
+        }
+
+        struct ScoreList *scores = &index->players[position].scores;
+        status = reserve(SystemTable, (void**)&scores->data, &scores->capacity, scores->size, sizeof(struct ScoreEntry));
+        if(EFI_ERROR(status)){
+                return status;
+        }
+        int low = 0, high = scores->size;
+        while(low < high){
+                int mid = (low + high) / 2;
+                if(scores->data[mid].score >= score){
+                        low = mid + 1;
+                }
+                else{
+                        high = mid;
+                }
+        }
+        for(int i = scores->size; i > low; i--){
+                scores->data[i] = scores->data[i - 1];
         }
+        struct ScoreEntry entry = {
+                .score = score,
+                .tieOrder = countAtLeast(index, score) - countAtLeast(index, score + 1)
+        };
+        scores->data[low] = entry;
+        scores->size++;
+
+        for(int i = score + 1; i <= MAX_SCORE + 1; i += i & -i){
+                index->tree[i]++;
+        }
+        index->total++;
+        return EFI_SUCCESS;
 }
 
-void intToString(int x, CHAR16* s){
-        if(x == 0){
-                s[0] = u'0';
-                s[1] = u'\0';
-                return;
+void freeScoreIndex(EFI_SYSTEM_TABLE *SystemTable, struct ScoreIndex *index){
+        for(int i = 0; i < index->size; i++){
+                uefi_call_wrapper(SystemTable->BootServices->FreePool, 1, index->players[i].scores.data);
         }
-        int i = 0;
-        while(x > 0){
-                s[i] = (x % 10) + u'0';
-                i++;
-                x /= 10;
+        if(index->players != NULL){
+                uefi_call_wrapper(SystemTable->BootServices->FreePool, 1, index->players);
         }
-        
-        for(int j = 0; j < i / 2; j++){
-                CHAR16 tmp = s[j];
-                s[j] = s[i - j - 1];
-                s[i - j - 1] = tmp;
+        SetMem(index, sizeof(struct ScoreIndex), 0);
+}
+
+EFI_STATUS loadScoreIndex(EFI_SYSTEM_TABLE *SystemTable, struct Storage *storage, struct ScoreIndex *index){
+        EFI_STATUS status;
+        UINTN size = storage->record.size;
+        if(size == 0){
+                return EFI_SUCCESS;
         }
-        s[i] = u'\0';
+        CHAR16 *records;
+        status = uefi_call_wrapper(SystemTable->BootServices->AllocatePool, 3, EfiLoaderData, size, (void**)&records);
+        if(EFI_ERROR(status)){
+                return status;
+        }
+        status = storageRead(&storage->record, 0, &size, records);
+
+        int count = size / SCORE_LENGTH;
+        for(int i = 0; i < count && !EFI_ERROR(status); i++){
+                CHAR16 *record = records + i * (SCORE_LENGTH / sizeof(CHAR16));
+                status = indexScore(SystemTable, index, record, parseScore(record));
+        }
+        uefi_call_wrapper(SystemTable->BootServices->FreePool, 1, records);
+        return status;
+}
+
+//The index is built lazily, normally while the menu is idle
+EFI_STATUS ensureScores(EFI_SYSTEM_TABLE *SystemTable, struct Storage *storage, struct ScoreIndex *index){
+        if(index->loaded){
+                return EFI_SUCCESS;
+        }
+        EFI_STATUS status = loadScoreIndex(SystemTable, storage, index);
+        if(EFI_ERROR(status)){
+                freeScoreIndex(SystemTable, index);
+                return status;
+        }
+        index->loaded = true;
+        return EFI_SUCCESS;
 }
 
-void saveScore(EFI_SYSTEM_TABLE *SystemTable, int result, CHAR16 name[4]){
+//Fallback for when the index can't be built: the first record with a lower score
+EFI_STATUS scanInsertPosition(struct StorageFile *file, int score, UINT64 *position){
+        CHAR16 read[7];
+        for(*position = 0; *position < file->size; *position += SCORE_LENGTH){
+                UINTN size = SCORE_LENGTH;
+                EFI_STATUS status = storageRead(file, *position, &size, read);
+                if(EFI_ERROR(status)){
+                        return status;
+                }
+                if(size < SCORE_LENGTH || score > parseScore(read)){
+                        break;
+                }
+        }
+        return EFI_SUCCESS;
+}
+
+//The index already knows where the record belongs, so only the tail of the file
+//is read once and written back shifted by one record, in one batch with the new one
+EFI_STATUS saveScore(EFI_SYSTEM_TABLE *SystemTable, struct Storage *storage, int result, CHAR16 name[4], struct ScoreIndex *index){
+        EFI_STATUS status;
         CHAR16 write[7]; 
-        CHAR16 read[7]; 
         
         write[0] = name[0];
         write[1] = name[1];
@@ -470,73 +1159,47 @@ void saveScore(EFI_SYSTEM_TABLE *SystemTable, int result, CHAR16 name[4]){
         write[4] = (result / 10) % 10 + u'0';
         write[5] = (result % 10) + u'0';
         write[6] = u'\0';
-        bool passed = false;
-        UINT64 position = 0;
-        
-        EFI_FILE_PROTOCOL* root;
-        EFI_FILE_PROTOCOL* file;
-        getFileProtocol(SystemTable, &root);
-        uefi_call_wrapper(root->Open, 5,
-                                root,
-                                &file,
-                                (CHAR16*)u"record.txt",
-                                EFI_FILE_MODE_CREATE | EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE,
-                                0
-        );
-
-        while(true){
-                UINTN size = SCORE_LENGTH;
-                uefi_call_wrapper(file->SetPosition, 2, file, position);
-                uefi_call_wrapper(file->Read, 3, file, &size, read);
-
-                if(size == 0){
-                        uefi_call_wrapper(file->SetPosition, 2, file, position);
-                        size = SCORE_LENGTH;
-                        uefi_call_wrapper(file->Write, 3, file, &size, write);
-                        break;
-                }
+        int stored = parseScore(write);
 
-                if(!passed){
-                        int currentScore = (read[3] - u'0') * 100 + (read[4] - u'0') * 10 + (read[5] - u'0');
-                        if(result > currentScore){
-                                passed = true;
-                        }
-                }
-
-                if(passed){
-                        uefi_call_wrapper(file->SetPosition, 2, file, position);
-                        size = SCORE_LENGTH;
-                        uefi_call_wrapper(file->Write, 3, file, &size, write);
-                        for(int i = 0; i < 7; i++){
-                                write[i] = read[i];
-                        }
+        struct StorageFile *file = &storage->record;
+        UINT64 position;
+        bool indexed = !EFI_ERROR(ensureScores(SystemTable, storage, index));
+        if(indexed){
+                position = countAtLeast(index, stored) * SCORE_LENGTH;
+        }
+        else{
+                status = scanInsertPosition(file, stored, &position);
+                if(EFI_ERROR(status)){
+                        return status;
                 }
-                position += SCORE_LENGTH;
         }
-        uefi_call_wrapper(file->Close, 1, file);
-        uefi_call_wrapper(root->Close, 1, root);
-}
-
-void printResult(EFI_SYSTEM_TABLE *SystemTable, int result){
-        uefi_call_wrapper(SystemTable->ConOut->ClearScreen, 1, SystemTable->ConOut);
-        uefi_call_wrapper(SystemTable->ConOut->SetAttribute, 2,
-                                SystemTable->ConOut, EFI_TEXT_ATTR(EFI_WHITE, EFI_BLACK));
-        uefi_call_wrapper(SystemTable->ConOut->SetCursorPosition, 3, SystemTable->ConOut, PADDING_LEFT, PADDING_UP); 
-        if(result == -1){
-                uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, u"ERROR OCCURED");
+        UINTN tailSize = file->size - min(position, file->size);
+        UINT8 *batch;
+        status = uefi_call_wrapper(SystemTable->BootServices->AllocatePool, 3,
+                                        EfiLoaderData, SCORE_LENGTH + tailSize, (void**)&batch);
+        if(EFI_ERROR(status)){
+                return status;
         }
-        else{
-                CHAR16 score[15];
-                intToString(result, score);
-                uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, u"YOUR SCORE: ");
-                uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, score);
+        CopyMem(batch, write, SCORE_LENGTH);
+        status = storageRead(file, position, &tailSize, batch + SCORE_LENGTH);
+        if(!EFI_ERROR(status)){
+                status = storageWrite(file, position, SCORE_LENGTH + tailSize, batch);
         }
+        if(!EFI_ERROR(status)){
+                status = storageFlush(file);
+        }
+        uefi_call_wrapper(SystemTable->BootServices->FreePool, 1, batch);
+        if(EFI_ERROR(status)){
+                return status;
+        }
+        //The record is already on disk, so a stale index is dropped and rebuilt from the file later
+        if(indexed && EFI_ERROR(indexScore(SystemTable, index, name, stored))){
+                freeScoreIndex(SystemTable, index);
+        }
+        return EFI_SUCCESS;
+}
 
-        uefi_call_wrapper(SystemTable->ConOut->SetCursorPosition, 3,
-                                SystemTable->ConOut, PADDING_LEFT, PADDING_UP + 2); 
-        uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, u"ENTER YOUR NAME: ");
-        int commandLength = PADDING_LEFT + 17;
-        CHAR16 name[4] = {u' ', u' ', u' ', u'\0'};
+void readName(EFI_SYSTEM_TABLE *SystemTable, CHAR16 name[4], int column, int row){
         int counter = 0;
         EFI_INPUT_KEY key;
         while(true){
@@ -549,7 +1212,7 @@ void printResult(EFI_SYSTEM_TABLE *SystemTable, int result){
                 if(key.UnicodeChar == BACKSPACE && counter > 0){
                         counter--;
                         uefi_call_wrapper(SystemTable->ConOut->SetCursorPosition, 3,
-                                                SystemTable->ConOut, commandLength + counter, PADDING_UP + 2);
+                                                SystemTable->ConOut, column + counter, row);
                         uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, u" ");
                         name[counter] = u' ';
                 }
@@ -558,66 +1221,61 @@ void printResult(EFI_SYSTEM_TABLE *SystemTable, int result){
                         name[counter] = key.UnicodeChar - 32;
                         CHAR16 str[2] = {name[counter], u'\0'};
                         uefi_call_wrapper(SystemTable->ConOut->SetCursorPosition, 3,
-                                                SystemTable->ConOut, commandLength + counter, PADDING_UP + 2);
+                                                SystemTable->ConOut, column + counter, row);
                         uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, str);
                         counter++;
                 }
         }
-        saveScore(SystemTable, result, name);
 }
 
-UINT64 getFileSize(EFI_SYSTEM_TABLE *SystemTable){
-        EFI_FILE_PROTOCOL* root;
-        EFI_FILE_PROTOCOL* file;
-        getFileProtocol(SystemTable, &root);
-        uefi_call_wrapper(root->Open, 5,
-                                root,
-                                &file,
-                                (CHAR16*)u"record.txt",
-                                EFI_FILE_MODE_CREATE | EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE,
-                                0
-        );
-        UINTN size = 0;
-        EFI_FILE_INFO *info;
-
-        uefi_call_wrapper(file->GetInfo, 4, file, &gEfiFileInfoGuid, &size, NULL);
-        uefi_call_wrapper(SystemTable->BootServices->AllocatePool, 3, EfiLoaderData, size, (void**)&info);
-        uefi_call_wrapper(file->GetInfo, 4, file, &gEfiFileInfoGuid, &size, info);
-
-        UINT64 fileSize = 0;
-        fileSize = info->FileSize;
-        uefi_call_wrapper(SystemTable->BootServices->FreePool, 1, info);
-
-        uefi_call_wrapper(file->Close, 1, file);
-        uefi_call_wrapper(root->Close, 1, root);
+void printResult(EFI_SYSTEM_TABLE *SystemTable, struct Storage *storage, int result, struct ScoreIndex *index){
+        uefi_call_wrapper(SystemTable->ConOut->ClearScreen, 1, SystemTable->ConOut);
+        uefi_call_wrapper(SystemTable->ConOut->SetAttribute, 2,
+                                SystemTable->ConOut, EFI_TEXT_ATTR(EFI_WHITE, EFI_BLACK));
+        uefi_call_wrapper(SystemTable->ConOut->SetCursorPosition, 3, SystemTable->ConOut, PADDING_LEFT, PADDING_UP); 
+        if(result == -1){
+                uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, u"ERROR OCCURED");
+        }
+        else{
+                CHAR16 score[15];
+                intToString(result, score);
+                uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, u"YOUR SCORE: ");
+                uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, score);
+        }
 
-        return fileSize;
+        uefi_call_wrapper(SystemTable->ConOut->SetCursorPosition, 3,
+                                SystemTable->ConOut, PADDING_LEFT, PADDING_UP + 2); 
+        uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, u"ENTER YOUR NAME: ");
+        int commandLength = PADDING_LEFT + 17;
+        CHAR16 name[4] = {u' ', u' ', u' ', u'\0'};
+        readName(SystemTable, name, commandLength, PADDING_UP + 2);
+        EFI_STATUS status = saveScore(SystemTable, storage, result, name, index);
+        if(EFI_ERROR(status)){
+                uefi_call_wrapper(SystemTable->ConOut->SetCursorPosition, 3,
+                                        SystemTable->ConOut, PADDING_LEFT, PADDING_UP + 4); 
+                uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, u"COULDN'T SAVE YOUR SCORE");
+                getKey(SystemTable);
+        }
 }
 
-int hallOfFame(EFI_SYSTEM_TABLE *SystemTable, int page, int maximum){
+int hallOfFame(EFI_SYSTEM_TABLE *SystemTable, struct Storage *storage, int page, int maximum){
         uefi_call_wrapper(SystemTable->ConOut->ClearScreen, 1, SystemTable->ConOut);
         uefi_call_wrapper(SystemTable->ConOut->SetAttribute, 2,
                                 SystemTable->ConOut, EFI_TEXT_ATTR(EFI_WHITE, EFI_BLACK));
-        EFI_FILE_PROTOCOL* root;
-        EFI_FILE_PROTOCOL* file;
-        getFileProtocol(SystemTable, &root);
-        uefi_call_wrapper(root->Open, 5,
-                                root,
-                                &file,
-                                (CHAR16*)u"record.txt",
-                                EFI_FILE_MODE_CREATE | EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE,
-                                0
-        );
 
         CHAR16 buffer[7];
         int counter = RESULTS_PER_PAGE * page + 1;
-        uefi_call_wrapper(file->SetPosition, 2, file, page * SCORE_LENGTH * RESULTS_PER_PAGE);
+        UINT64 position = page * SCORE_LENGTH * RESULTS_PER_PAGE;
         for(int i = 0; i < RESULTS_PER_PAGE; i++){
                 uefi_call_wrapper(SystemTable->ConOut->SetCursorPosition, 3,
                                         SystemTable->ConOut, PADDING_LEFT, PADDING_UP + i); 
                 UINTN size = SCORE_LENGTH;
-                uefi_call_wrapper(file->Read, 3, file, &size, buffer);
-                if(size == 0){
+                EFI_STATUS status = storageRead(&storage->record, position + i * SCORE_LENGTH, &size, buffer);
+                if(EFI_ERROR(status)){
+                        uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, u"COULDN'T READ THE RECORDS");
+                        break;
+                }
+                if(size < SCORE_LENGTH){
                         break;
                 }
                 CHAR16 index[15];
@@ -657,11 +1315,71 @@ int hallOfFame(EFI_SYSTEM_TABLE *SystemTable, int page, int maximum){
         uefi_call_wrapper(SystemTable->ConOut->SetCursorPosition, 3,
                                 SystemTable->ConOut, PADDING_LEFT, PADDING_UP + RESULTS_PER_PAGE + 2); 
         uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, u"PRESS Q TO LEAVE");
+        uefi_call_wrapper(SystemTable->ConOut->SetCursorPosition, 3,
+                                SystemTable->ConOut, PADDING_LEFT, PADDING_UP + RESULTS_PER_PAGE + 3); 
+        uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, u"PRESS F TO FILTER");
+
+        while(true){
+                EFI_INPUT_KEY key = getKey(SystemTable);
+                if(key.ScanCode == SCANCODE_LEFT_ARROW && page - 1 >= 0){
+                        return page - 1;
+                }
+                if(key.ScanCode == SCANCODE_RIGHT_ARROW && page + 1 <= maximum){
+                        return page + 1;
+                }
+                if(key.UnicodeChar == u'q'){
+                        return -1;
+                }
+                if(key.UnicodeChar == u'f'){
+                        return FILTER;
+                }
+        }
 
-        uefi_call_wrapper(file->Close, 1, file);
-        uefi_call_wrapper(root->Close, 1, root);
+}
+
+//Same layout as hallOfFame, but served from the score index instead of record.txt
+int playerPage(EFI_SYSTEM_TABLE *SystemTable, struct ScoreIndex *index, struct PlayerScores *player, int page, int maximum){
+        uefi_call_wrapper(SystemTable->ConOut->ClearScreen, 1, SystemTable->ConOut);
+        uefi_call_wrapper(SystemTable->ConOut->SetAttribute, 2,
+                                SystemTable->ConOut, EFI_TEXT_ATTR(EFI_WHITE, EFI_BLACK));
+        CHAR16 number[15];
+        uefi_call_wrapper(SystemTable->ConOut->SetCursorPosition, 3,
+                                SystemTable->ConOut, PADDING_LEFT, PADDING_UP); 
+        uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, player->name);
+        uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, u" - BEST: ");
+        intToString(personalBest(index, player->name), number);
+        uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, number);
+        uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, u", RANK: ");
+        intToString(playerRank(index, player->name), number);
+        uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, number);
+
+        struct ScoreEntry scores[RESULTS_PER_PAGE];
+        int count = topScores(index, player->name, page * RESULTS_PER_PAGE, RESULTS_PER_PAGE, scores);
+        for(int i = 0; i < count; i++){
+                uefi_call_wrapper(SystemTable->ConOut->SetCursorPosition, 3,
+                                        SystemTable->ConOut, PADDING_LEFT, PADDING_UP + 2 + i); 
+                intToString(globalRank(index, &scores[i]), number);
+                uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, number);
+                uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, u". ");
+                intToString(scores[i].score, number);
+                uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, number);
+        }
 
+        CHAR16 curr[15];
+        CHAR16 maxPage[15];
+        intToString(page + 1, curr);
+        intToString(maximum + 1, maxPage);
+        uefi_call_wrapper(SystemTable->ConOut->SetCursorPosition, 3,
+                                SystemTable->ConOut, PADDING_LEFT, PADDING_UP + RESULTS_PER_PAGE + 3); 
+        uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, u"<- (");
+        uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, curr);
+        uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, u"/");
+        uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, maxPage);
+        uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, u") ->");
 
+        uefi_call_wrapper(SystemTable->ConOut->SetCursorPosition, 3,
+                                SystemTable->ConOut, PADDING_LEFT, PADDING_UP + RESULTS_PER_PAGE + 4); 
+        uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, u"PRESS Q TO LEAVE");
 
         while(true){
                 EFI_INPUT_KEY key = getKey(SystemTable);
@@ -675,22 +1393,205 @@ int hallOfFame(EFI_SYSTEM_TABLE *SystemTable, int page, int maximum){
                         return -1;
                 }
         }
+}
+
+void playerView(EFI_SYSTEM_TABLE *SystemTable, struct ScoreIndex *index){
+        uefi_call_wrapper(SystemTable->ConOut->ClearScreen, 1, SystemTable->ConOut);
+        uefi_call_wrapper(SystemTable->ConOut->SetAttribute, 2,
+                                SystemTable->ConOut, EFI_TEXT_ATTR(EFI_WHITE, EFI_BLACK));
+        uefi_call_wrapper(SystemTable->ConOut->SetCursorPosition, 3, SystemTable->ConOut, PADDING_LEFT, PADDING_UP); 
+        uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, u"PLAYER NAME: ");
+        CHAR16 name[4] = {u' ', u' ', u' ', u'\0'};
+        readName(SystemTable, name, PADDING_LEFT + 13, PADDING_UP);
+
+        struct PlayerScores *player = getPlayer(index, name);
+        if(player == NULL){
+                uefi_call_wrapper(SystemTable->ConOut->SetCursorPosition, 3,
+                                        SystemTable->ConOut, PADDING_LEFT, PADDING_UP + 2); 
+                uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, u"NO RESULTS");
+                uefi_call_wrapper(SystemTable->ConOut->SetCursorPosition, 3,
+                                        SystemTable->ConOut, PADDING_LEFT, PADDING_UP + 3); 
+                uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, u"PRESS Q TO LEAVE");
+                while(getKey(SystemTable).UnicodeChar != u'q');
+                return;
+        }
 
+        int page = 0;
+        int maximum = (player->scores.size - 1) / RESULTS_PER_PAGE;
+        while(true){
+                page = playerPage(SystemTable, index, player, page, maximum);
+                if(page == -1){
+                        break;
+                }
+        }
 }
 
-void hall(EFI_SYSTEM_TABLE *SystemTable){
+void hall(EFI_SYSTEM_TABLE *SystemTable, struct Storage *storage, struct ScoreIndex *index){
         int page = 0, maximum;
-        UINT64 fileSize = getFileSize(SystemTable);
+        UINT64 fileSize = storage->record.size;
         maximum = fileSize / (RESULTS_PER_PAGE * SCORE_LENGTH);
         if(fileSize % (RESULTS_PER_PAGE * SCORE_LENGTH) == 0){
                 maximum--;
         }
 
         while(true){
-                page = hallOfFame(SystemTable, page, maximum);
+                page = hallOfFame(SystemTable, storage, page, maximum);
                 if(page == -1){
                         break;
                 }
+                if(page == FILTER){
+                        EFI_STATUS status = ensureScores(SystemTable, storage, index);
+                        if(EFI_ERROR(status)){
+                                showMessage(SystemTable, u"COULDN'T LOAD THE SCORES");
+                        }
+                        else{
+                                playerView(SystemTable, index);
+                        }
+                        page = 0;
+                }
+        }
+}
+
+int appendString(CHAR16 *buffer, int length, const CHAR16 *s){
+        while(*s != u'\0'){
+                buffer[length++] = *s++;
+        }
+        return length;
+}
+
+int appendTime(CHAR16 *buffer, int length, const CHAR16 *name, int microseconds){
+        CHAR16 number[15];
+        intToString(microseconds, number);
+        length = appendString(buffer, length, name);
+        length = appendString(buffer, length, u" ");
+        length = appendString(buffer, length, number);
+        return appendString(buffer, length, u" us\r\n");
+}
+
+//Phases are reported as time since efi_main was entered
+EFI_STATUS writeProfile(EFI_SYSTEM_TABLE *SystemTable, struct Storage *storage, struct Profile *profile){
+        CHAR16 report[(MAX_PHASES + 1) * 40];
+        int length = 0;
+        for(int i = 0; i < profile->count; i++){
+                length = appendTime(report, length, profile->names[i], toMicroseconds(profile, profile->times[i] - profile->start));
+        }
+        if(profile->playDrawn != 0){
+                length = appendTime(report, length, u"play->frame", toMicroseconds(profile, profile->playDrawn - profile->playPressed));
+        }
+
+        struct StorageFile file;
+        if(!EFI_ERROR(storageOpen(SystemTable, storage, PROFILE_FILE, false, &file))){
+                storageDelete(SystemTable, &file);
+        }
+        EFI_STATUS status = storageOpen(SystemTable, storage, PROFILE_FILE, true, &file);
+        if(EFI_ERROR(status)){
+                return status;
+        }
+        status = storageWrite(&file, 0, length * sizeof(CHAR16), report);
+        EFI_STATUS closeStatus = storageClose(SystemTable, &file);
+        return EFI_ERROR(status) ? status : closeStatus;
+}
+
+//Runs one piece of non-critical work per idle tick, returns false once nothing is left
+bool runIdleTask(EFI_SYSTEM_TABLE *SystemTable, struct Storage *storage, struct ScoreIndex *scores, struct Devices *devices, struct Profile *profile){
+        if(profile->ticksPerMs == 0){
+                calibrateProfile(SystemTable, profile);
+                return true;
+        }
+        if(!scores->loaded){
+                if(!EFI_ERROR(ensureScores(SystemTable, storage, scores))){
+                        return true;
+                }
+        }
+        if(devices->surface == NULL){
+                if(!EFI_ERROR(prepareSurface(SystemTable, devices))){
+                        return true;
+                }
+        }
+        if(profile->reportPending){
+                profile->reportPending = false;
+                writeProfile(SystemTable, storage, profile);
+        }
+        return false;
+}
+
+int menu(EFI_SYSTEM_TABLE *SystemTable, struct Storage *storage, struct ScoreIndex *scores, struct Devices *devices, struct Profile *profile){
+        uefi_call_wrapper(SystemTable->ConOut->SetAttribute, 2,
+                                SystemTable->ConOut, EFI_TEXT_ATTR(EFI_WHITE, EFI_BLACK));
+        int currentSelection = PLAY;
+        const CHAR16 *options[] = {
+                u"      PLAY      ",
+                u"     RESUME     ",
+                u"  HALL OF FAME  ",
+                u"      QUIT      "
+        };
+
+        EFI_EVENT idle;
+        uefi_call_wrapper(SystemTable->BootServices->CreateEvent, 5, EVT_TIMER, 0, NULL, NULL, &idle);
+        uefi_call_wrapper(SystemTable->BootServices->SetTimer, 3, idle, TimerPeriodic, IDLE_INTERVAL);
+
+        bool change = true;
+        while(true){
+                if(change){
+                        change = false;
+                        uefi_call_wrapper(SystemTable->ConOut->ClearScreen, 1, SystemTable->ConOut);
+                        for(int i = 0; i < MENU_OPTIONS; i++){
+                                uefi_call_wrapper(SystemTable->ConOut->SetCursorPosition, 3,
+                                                        SystemTable->ConOut, PADDING_LEFT, PADDING_UP + i);
+                                if(i == currentSelection){
+                                        uefi_call_wrapper(SystemTable->ConOut->SetAttribute, 2,
+                                                                SystemTable->ConOut,
+                                                                EFI_TEXT_ATTR(EFI_WHITE, EFI_BROWN)
+                                        );
+                                        uefi_call_wrapper(SystemTable->ConOut->OutputString, 2,
+                                                                SystemTable->ConOut, options[i]);
+                                        uefi_call_wrapper(SystemTable->ConOut->SetAttribute, 2,
+                                                                SystemTable->ConOut,
+                                                                EFI_TEXT_ATTR(EFI_WHITE, EFI_BLACK)
+                                        );
+                                }
+                                else{
+                                        uefi_call_wrapper(SystemTable->ConOut->OutputString, 2,
+                                                                SystemTable->ConOut, options[i]);
+                                }
+                        }
+                }
+                if(!profile->menuDrawn){
+                        profile->menuDrawn = true;
+                        markPhase(profile, u"menu");
+                }
+
+                UINTN index;
+                EFI_EVENT events[2] = {SystemTable->ConIn->WaitForKey, idle};
+                uefi_call_wrapper(SystemTable->BootServices->WaitForEvent, 3, 2, events, &index);
+                if(index == 1){
+                        if(!runIdleTask(SystemTable, storage, scores, devices, profile)){
+                                uefi_call_wrapper(SystemTable->BootServices->SetTimer, 3, idle, TimerCancel, 0);
+                        }
+                        continue;
+                }
+                EFI_INPUT_KEY key;
+                EFI_STATUS status = uefi_call_wrapper(SystemTable->ConIn->ReadKeyStroke, 2, SystemTable->ConIn, &key);
+                if(EFI_ERROR(status)){
+                        continue;
+                }
+
+                if(key.ScanCode == SCANCODE_UP_ARROW){
+                        change = (currentSelection != PLAY);
+                        if(change){
+                                currentSelection--;
+                        }
+                }
+                else if(key.ScanCode == SCANCODE_DOWN_ARROW){
+                        change = (currentSelection != QUIT);
+                        if(change){
+                                currentSelection++;
+                        }
+                }
+                else if(key.UnicodeChar == ENTER){
+                        uefi_call_wrapper(SystemTable->BootServices->CloseEvent, 1, idle);
+                        return currentSelection;
+                }
         }
 }
 
@@ -698,6 +1599,8 @@ EFI_STATUS
 EFIAPI
 efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable){
         (void)ImageHandle;
+        struct Profile profile = {0};
+        profile.start = readTimestamp();
 
         //FOR DEBUGGING
         EFI_LOADED_IMAGE_PROTOCOL *loaded_image;
@@ -709,24 +1612,59 @@ efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable){
         *image_base_ptr = (uint64_t)loaded_image->ImageBase;
         *marker_ptr = 0xDEADBEEF;
         //FOR DEBUGGING
+        markPhase(&profile, u"image");
+
+        struct Storage storage;
+        EFI_STATUS storageStatus = storageInit(SystemTable, &storage);
+        if(EFI_ERROR(storageStatus)){
+                uefi_call_wrapper(SystemTable->ConOut->OutputString, 2, SystemTable->ConOut, u"Couldn't open storage");
+                uefi_call_wrapper(SystemTable->RuntimeServices->ResetSystem, 4,
+                                        EfiResetShutdown, EFI_SUCCESS, 0, NULL);
+                return storageStatus;
+        }
+        markPhase(&profile, u"storage");
+
+        struct Devices devices;
+        EFI_STATUS devicesStatus = initDevices(SystemTable, &devices);
+        if(EFI_ERROR(devicesStatus)){
+                uefi_call_wrapper(SystemTable->RuntimeServices->ResetSystem, 4,
+                                        EfiResetShutdown, EFI_SUCCESS, 0, NULL);
+                return devicesStatus;
+        }
+        markPhase(&profile, u"protocols");
+
+        if(devices.gop->Mode->Mode != 0){
+                uefi_call_wrapper(devices.gop->SetMode, 2, devices.gop, 0);
+        }
+        markPhase(&profile, u"mode");
+
+        //Loaded by the menu once it is idle
+        struct ScoreIndex scores = {0};
 
         while(true){
-                int choice = menu(SystemTable);
+                int choice = menu(SystemTable, &storage, &scores, &devices, &profile);
 
                 if(choice == QUIT){
                         break;
                 }
 
-                if(choice == PLAY){
-                        int result = snake(SystemTable);
-                        printResult(SystemTable, result);
+                if(choice == PLAY || choice == RESUME){
+                        int result = snake(SystemTable, &storage, &devices, &profile, choice == RESUME);
+                        if(result != NO_RESULT){
+                                printResult(SystemTable, &storage, result, &scores);
+                        }
                 }
 
                 else if(choice == HALL){
-                        hall(SystemTable);
+                        hall(SystemTable, &storage, &scores);
                 }
         }
 
+        freeScoreIndex(SystemTable, &scores);
+        if(devices.surface != NULL){
+                uefi_call_wrapper(SystemTable->BootServices->FreePool, 1, devices.surface);
+        }
+        storageShutdown(SystemTable, &storage);
         uefi_call_wrapper(SystemTable->RuntimeServices->ResetSystem, 4, EfiResetShutdown, EFI_SUCCESS, 0, NULL);
 
         return EFI_SUCCESS;